@@ -32,6 +32,10 @@ namespace user_reg
 struct Config
 {
     uint32_t    expiration_days;
+    uint32_t    max_pending_registrations;  // 0 - unlimited
+    uint64_t    max_pending_memory;         // approximate bytes, 0 - unlimited
+    bool        reject_on_overflow;         // true - reject new registration, false - evict the ones closest to expiry
+    uint32_t    expiry_warning_sec;         // send EXPIRING event this long before expiration, 0 - disabled
 };
 
 } // namespace user_reg
@@ -0,0 +1,63 @@
+/*
+
+User Reg. Events.
+
+Copyright (C) 2019 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 13849 $ $Date:: 2020-09-26 #$ $Author: serge $
+
+#ifndef USER_REG__EVENTS_H
+#define USER_REG__EVENTS_H
+
+#include <vector>           // std::vector
+
+#include "user_manager/user_manager.h"  // user_id_t, utils::epoch32_t
+
+namespace user_reg
+{
+
+enum class event_type_e
+{
+    REGISTERED  = 0,
+    CONFIRMED,
+    EXPIRING,       // expires within Config::expiry_warning_sec
+    EXPIRED,
+    EVICTED,        // removed to make room for a new registration
+};
+
+struct Event
+{
+    event_type_e                type;
+    user_manager::user_id_t     user_id;
+    utils::epoch32_t            expiration;
+    utils::epoch32_t            timestamp;
+    uint64_t                    seq;        // consecutive, a gap means that events were dropped
+};
+
+class IEventSink
+{
+public:
+    virtual ~IEventSink() {};
+
+    // called from the worker thread of UserReg, outside of its lock
+    virtual void handle_events( const std::vector<Event> & events ) = 0;
+};
+
+} // namespace user_reg
+
+#endif // USER_REG__EVENTS_H
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <mutex>            // std::mutex
 
 #include "user_reg.h"
 
@@ -32,6 +33,53 @@ void init( user_manager::UserManager * um, user_reg::UserReg * ur, uint32_t expi
     ur->set_speedup_factor( speedup_factor );
 }
 
+void init_limited( user_manager::UserManager * um, user_reg::UserReg * ur, uint32_t max_pending, uint64_t max_memory, bool reject_on_overflow )
+{
+    user_reg::Config config = { 1, max_pending, max_memory, reject_on_overflow };
+
+    um->init();
+
+    ur->init( config, um );
+}
+
+class EventCollector: public user_reg::IEventSink
+{
+public:
+
+    void handle_events( const std::vector<user_reg::Event> & events ) override
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+
+        for( auto & e : events )
+        {
+            std::cout << "event: type " << int( e.type ) << ", user id " << e.user_id << ", expiration " << e.expiration << "\n";
+
+            types_.push_back( e.type );
+            seqs_.push_back( e.seq );
+        }
+    }
+
+    std::vector<user_reg::event_type_e> get_types()
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+
+        return types_;
+    }
+
+    std::vector<uint64_t> get_seqs()
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+
+        return seqs_;
+    }
+
+private:
+
+    std::mutex                          mutex_;
+    std::vector<user_reg::event_type_e> types_;
+    std::vector<uint64_t>               seqs_;
+};
+
 bool register_user_1(
         user_reg::UserReg           * ur,
         user_reg::user_id_t         * user_id,
@@ -279,7 +327,13 @@ void test_06_read_config()
 
         ur.init( config, & um );
 
-        res = true;
+        res = ( config.max_pending_registrations == 1000 )
+            && ( config.max_pending_memory == 1000000 )
+            && ( config.reject_on_overflow == true )
+            && ( config.expiry_warning_sec == 3600 );
+
+        if( res == false )
+            error_msg   = "unexpected config values";
     }
     catch( std::exception & e )
     {
@@ -289,6 +343,362 @@ void test_06_read_config()
     log_test( "test_06_read_config", res, true, "config read successfully", "cannot read", error_msg );
 }
 
+void test_07_limit_evict_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    user_reg::Config config = { 10, 2, 0, false };
+
+    um.init();
+    ur.init( config, & um );
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key_1;
+    std::string         registration_key_2;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key_1, & error_msg );     // expires in 10 days
+
+    ur.set_speedup_factor( 24 * 60 * 60 );
+
+    b &= register_user_2( & ur, & user_id, & registration_key_2, & error_msg );         // expires in 10 sec
+    b &= register_user_3( & ur, & user_id, & registration_key, & error_msg );
+
+    auto usage = ur.get_memory_usage();
+
+    b &= ( usage.pending_registrations == 2 );
+
+    // the registration closest to expiry is evicted, not the oldest one
+    b &= ( ur.confirm_registration( registration_key_2, & error_msg ) == false );
+    b &= ur.confirm_registration( registration_key_1, & error_msg );
+
+    log_test( "test_07_limit_evict_ok_1", b, true, "registration closest to expiry was evicted", "registration closest to expiry was not evicted", error_msg );
+}
+
+void test_07_limit_reject_nok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 2, 0, true );
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    register_user_1( & ur, & user_id, & registration_key, & error_msg );
+    register_user_2( & ur, & user_id, & registration_key, & error_msg );
+    auto b = register_user_3( & ur, & user_id, & registration_key, & error_msg );
+
+    log_test( "test_07_limit_reject_nok_1", b, false, "registration over the limit was rejected", "registration over the limit was unexpectedly added", error_msg );
+}
+
+void test_07_limit_memory_evict_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 0, 1200, false );     // fits two registrations
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key_1;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key_1, & error_msg );
+    b &= register_user_2( & ur, & user_id, & registration_key, & error_msg );
+    b &= register_user_3( & ur, & user_id, & registration_key, & error_msg );
+
+    auto usage = ur.get_memory_usage();
+
+    b &= ( usage.pending_registrations == 2 ) && ( usage.pending_memory <= 1200 );
+
+    b &= ( ur.is_key_pending( registration_key_1 ) == false );
+
+    log_test( "test_07_limit_memory_evict_ok_1", b, true, "registration was evicted to fit memory limit", "registration was not evicted to fit memory limit", error_msg );
+}
+
+void test_07_limit_memory_nok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 0, 100, false );      // less than a single registration
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+
+    auto res = um.select_users__unlocked( user_manager::User::STATUS, anyvalue::comparison_type_e::EQ, int( user_manager::status_e::WAITING_REGISTRATION_CONFIRMATION ) );
+
+    // rejected user must be rolled back
+    b |= ( ur.get_memory_usage().pending_registrations != 0 ) || ( res.empty() == false );
+
+    log_test( "test_07_limit_memory_nok_1", b, false, "registration over memory limit was rejected", "registration over memory limit was unexpectedly added", error_msg );
+}
+
+void test_07_limit_memory_nok_2()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 0, 1200, false );     // fits two registrations
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key_1;
+    std::string         registration_key_2;
+    std::string         error_msg;
+
+    register_user_1( & ur, & user_id, & registration_key_1, & error_msg );
+    register_user_2( & ur, & user_id, & registration_key_2, & error_msg );
+
+    auto b = ur.register_new_user( 1, std::string( 2000, 'x' ) + "@example.com", "\xe1\xe1\xe1", & user_id, & registration_key_1, & error_msg );
+
+    // oversized registration must not evict the pending ones
+    b |= ( ur.get_memory_usage().pending_registrations != 2 ) || ( ur.is_key_pending( registration_key_2 ) == false );
+
+    log_test( "test_07_limit_memory_nok_2", b, false, "oversized registration was rejected without eviction", "oversized registration evicted pending ones or was added", error_msg );
+}
+
+void test_07_limit_duplicate_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 2, 0, false );
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key_1;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key_1, & error_msg );
+    b &= register_user_2( & ur, & user_id, & registration_key, & error_msg );
+
+    b &= ( register_user_1( & ur, & user_id, & registration_key, & error_msg ) == false );
+
+    b &= ( ur.get_memory_usage().pending_registrations == 2 );
+
+    b &= ur.is_key_pending( registration_key_1 );
+
+    log_test( "test_07_limit_duplicate_ok_1", b, true, "duplicated registration didn't evict pending ones", "duplicated registration evicted pending ones", error_msg );
+}
+
+void test_07_memory_usage_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init_limited( & um, & ur, 0, 0, false );
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+    b &= register_user_2( & ur, & user_id, & registration_key, & error_msg );
+
+    auto usage_1 = ur.get_memory_usage();
+
+    b &= ur.confirm_registration( registration_key, & error_msg );
+
+    auto usage_2 = ur.get_memory_usage();
+
+    b &= ( usage_1.pending_registrations == 2 ) && ( usage_2.pending_registrations == 1 ) && ( usage_2.pending_memory < usage_1.pending_memory );
+
+    log_test( "test_07_memory_usage_ok_1", b, true, "memory usage was accounted", "memory usage was not accounted", error_msg );
+}
+
+void test_08_read_queries_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init( & um, & ur, 1, 1 );
+
+    user_reg::user_id_t user_id_1;
+    user_reg::user_id_t user_id_2;
+    std::string         registration_key_1;
+    std::string         registration_key_2;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id_1, & registration_key_1, & error_msg );
+    b &= register_user_2( & ur, & user_id_2, & registration_key_2, & error_msg );
+
+    b &= ur.confirm_registration( registration_key_2, & error_msg );
+
+    b &= ( ur.pending_count() == 1 );
+    b &= ur.is_key_pending( registration_key_1 );
+    b &= ( ur.is_key_pending( registration_key_2 ) == false );
+    b &= ( ur.is_key_pending( "asdasd" ) == false );
+    b &= ( ur.get_registration_status( user_id_1 ) == user_reg::registration_status_e::PENDING );
+    b &= ( ur.get_registration_status( user_id_2 ) == user_reg::registration_status_e::CONFIRMED );
+    b &= ( ur.get_registration_status( 12345 ) == user_reg::registration_status_e::UNKNOWN );
+
+    log_test( "test_08_read_queries_ok_1", b, true, "queries returned expected results", "queries returned unexpected results", error_msg );
+}
+
+void test_08_read_queries_ok_2()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+
+    init( & um, & ur, 2, 24 * 60 * 60 );    // expire in 2 sec
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+
+    THIS_THREAD_SLEEP_SEC( 3 );
+
+    // read-only queries don't remove expired registrations
+    b &= ( ur.is_key_pending( registration_key ) == false );
+    b &= ( ur.get_registration_status( user_id ) == user_reg::registration_status_e::EXPIRED );
+    b &= ( ur.pending_count() == 1 );
+
+    log_test( "test_08_read_queries_ok_2", b, true, "expired registration was reported", "expired registration was not reported", error_msg );
+}
+
+void test_09_events_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+    EventCollector    ec;
+
+    user_reg::Config config = { 1 };
+
+    um.init();
+    ur.init( config, & um, & ec );
+    ur.start();
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+
+    b &= ur.confirm_registration( registration_key, & error_msg );
+
+    ur.shutdown();
+
+    std::vector<user_reg::event_type_e> expected = { user_reg::event_type_e::REGISTERED, user_reg::event_type_e::CONFIRMED };
+
+    b &= ( ec.get_types() == expected );
+
+    log_test( "test_09_events_ok_1", b, true, "events were delivered", "events were not delivered", error_msg );
+}
+
+void test_09_events_ok_2()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+    EventCollector    ec;
+
+    user_reg::Config config = { 2, 0, 0, false, 10 };
+
+    um.init();
+    ur.init( config, & um, & ec );
+    ur.set_speedup_factor( 24 * 60 * 60 );  // expire in 2 sec
+    ur.start();
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+
+    THIS_THREAD_SLEEP_SEC( 4 );
+
+    ur.shutdown();
+
+    std::vector<user_reg::event_type_e> expected = { user_reg::event_type_e::REGISTERED, user_reg::event_type_e::EXPIRING, user_reg::event_type_e::EXPIRED };
+
+    b &= ( ec.get_types() == expected );
+
+    log_test( "test_09_events_ok_2", b, true, "expiring and expired events were delivered", "expiring and expired events were not delivered", error_msg );
+}
+
+void test_09_events_evicted_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+    EventCollector    ec;
+
+    user_reg::Config config = { 1, 1, 0, false };
+
+    um.init();
+    ur.init( config, & um, & ec );
+    ur.start();
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    auto b = register_user_1( & ur, & user_id, & registration_key, & error_msg );
+    b &= register_user_2( & ur, & user_id, & registration_key, & error_msg );
+
+    ur.shutdown();
+
+    std::vector<user_reg::event_type_e> expected = { user_reg::event_type_e::REGISTERED, user_reg::event_type_e::EVICTED, user_reg::event_type_e::REGISTERED };
+
+    b &= ( ec.get_types() == expected );
+
+    log_test( "test_09_events_evicted_ok_1", b, true, "evicted event was delivered", "evicted event was not delivered", error_msg );
+}
+
+void test_09_events_overflow_ok_1()
+{
+    user_manager::UserManager   um;
+    user_reg::UserReg ur;
+    EventCollector    ec;
+
+    user_reg::Config config = { 1 };
+
+    um.init();
+    ur.init( config, & um, & ec );
+
+    user_reg::user_id_t user_id;
+    std::string         registration_key;
+    std::string         error_msg;
+
+    const uint32_t num = 4100;    // event queue holds 4096 events
+
+    bool b = true;
+
+    // worker is not started yet, so events are queued until the queue is full
+    for( uint32_t i = 0; i < num; ++i )
+    {
+        b &= ur.register_new_user( 1, "user" + std::to_string( i ) + "@example.com", "\xff\xff\xff", & user_id, & registration_key, & error_msg );
+    }
+
+    b &= ( ur.get_dropped_events() == 4 );
+
+    ur.start();
+    ur.shutdown();
+
+    auto seqs = ec.get_seqs();
+
+    b &= ( seqs.size() == 4096 ) && ( seqs.back() == 4095 );
+
+    b &= register_user_1( & ur, & user_id, & registration_key, & error_msg );
+
+    ur.start();
+    ur.shutdown();
+
+    seqs = ec.get_seqs();
+
+    // the gap is visible to the consumer: seq jumps from 4095 to 4100
+    b &= ( seqs.size() == 4097 ) && ( seqs.back() == num );
+
+    log_test( "test_09_events_overflow_ok_1", b, true, "dropped events were detected", "dropped events were not detected", error_msg );
+}
+
 int main()
 {
     dummy_logger::set_log_level( log_levels_log4j::Debug );
@@ -304,6 +714,19 @@ int main()
     test_05_show_pending_ok_2();
     test_05_show_pending_ok_3();
     test_06_read_config();
+    test_07_limit_evict_ok_1();
+    test_07_limit_reject_nok_1();
+    test_07_limit_memory_evict_ok_1();
+    test_07_limit_memory_nok_1();
+    test_07_limit_memory_nok_2();
+    test_07_limit_duplicate_ok_1();
+    test_07_memory_usage_ok_1();
+    test_08_read_queries_ok_1();
+    test_08_read_queries_ok_2();
+    test_09_events_ok_1();
+    test_09_events_ok_2();
+    test_09_events_evicted_ok_1();
+    test_09_events_overflow_ok_1();
 
     return EXIT_SUCCESS;
 }
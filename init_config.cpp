@@ -30,7 +30,16 @@ namespace user_reg
 
 void init_config( Config * cfg, const std::string & section_name, const config_reader::ConfigReader & cr )
 {
+    cfg->max_pending_registrations  = 0;
+    cfg->max_pending_memory         = 0;
+    cfg->reject_on_overflow         = false;
+    cfg->expiry_warning_sec         = 0;
+
     GET_VALUE_CONVERTED( cr, cfg, expiration_days, section_name, true );
+    GET_VALUE_CONVERTED( cr, cfg, max_pending_registrations, section_name, false );
+    GET_VALUE_CONVERTED( cr, cfg, max_pending_memory, section_name, false );
+    GET_VALUE_CONVERTED( cr, cfg, reject_on_overflow, section_name, false );
+    GET_VALUE_CONVERTED( cr, cfg, expiry_warning_sec, section_name, false );
 }
 
 } // namespace user_reg
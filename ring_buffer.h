@@ -0,0 +1,93 @@
+/*
+
+Lock-free single-producer single-consumer ring buffer.
+
+Copyright (C) 2019 Sergey Kolevatov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// $Revision: 13849 $ $Date:: 2020-09-26 #$ $Author: serge $
+
+#ifndef USER_REG__RING_BUFFER_H
+#define USER_REG__RING_BUFFER_H
+
+#include <array>            // std::array
+#include <atomic>           // std::atomic
+#include <vector>           // std::vector
+#include <cstdint>          // uint32_t
+#include <algorithm>        // std::min
+
+namespace user_reg
+{
+
+template <class T, uint32_t N>
+class RingBuffer
+{
+    static_assert( N > 0 && ( N & ( N - 1 ) ) == 0, "N must be a power of 2" );
+
+public:
+
+    RingBuffer():
+        head_( 0 ),
+        tail_( 0 )
+    {
+    }
+
+    // producer side, returns false if the buffer is full
+    bool push( const T & e )
+    {
+        auto tail = tail_.load( std::memory_order_relaxed );
+        auto head = head_.load( std::memory_order_acquire );
+
+        if( tail - head == N )
+            return false;
+
+        buffer_[ tail & ( N - 1 ) ] = e;
+
+        tail_.store( tail + 1, std::memory_order_release );
+
+        return true;
+    }
+
+    // consumer side, appends up to max_size elements to res, returns number of appended elements
+    uint32_t pop( std::vector<T> * res, uint32_t max_size )
+    {
+        auto head = head_.load( std::memory_order_relaxed );
+        auto tail = tail_.load( std::memory_order_acquire );
+
+        auto size = std::min( tail - head, max_size );
+
+        for( uint32_t i = 0; i < size; ++i )
+        {
+            res->push_back( buffer_[ ( head + i ) & ( N - 1 ) ] );
+        }
+
+        head_.store( head + size, std::memory_order_release );
+
+        return size;
+    }
+
+private:
+
+    std::array<T,N>         buffer_;
+
+    std::atomic<uint32_t>   head_;  // next element to read, owned by consumer
+    std::atomic<uint32_t>   tail_;  // next element to write, owned by producer
+};
+
+} // namespace user_reg
+
+#endif // USER_REG__RING_BUFFER_H
@@ -24,6 +24,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "user_reg.h"                   // self
 
 #include <set>
+#include <chrono>                         // std::chrono
 
 #include "utils/mutex_helper.h"         // MUTEX_SCOPE_LOCK
 #include "utils/dummy_logger.h"         // dummy_log
@@ -39,8 +40,21 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 namespace user_reg
 {
 
+// rough cost of one pending registration: user record in UserManager, its indices and own bookkeeping
+const uint64_t PENDING_OVERHEAD_SIZE    = 512;
+
+const uint32_t WORKER_INTERVAL_MS       = 100;
+const uint32_t MAX_EVENT_BATCH_SIZE     = 256;
+
 UserReg::UserReg():
-        user_manager_( nullptr )
+        user_manager_( nullptr ),
+        pending_memory_( 0 ),
+        pending_count_( 0 ),
+        event_sink_( nullptr ),
+        next_event_seq_( 0 ),
+        dropped_events_( 0 ),
+        is_dropping_( false ),
+        must_stop_( false )
 #ifdef DEBUG
 , speedup_factor_( 1 )
 #endif
@@ -49,22 +63,84 @@ UserReg::UserReg():
 
 UserReg::~UserReg()
 {
+    shutdown();
 }
 
 bool UserReg::init(
         const Config                & config,
-        user_manager::UserManager   * user_manager )
+        user_manager::UserManager   * user_manager,
+        IEventSink                  * event_sink )
 {
     assert( user_manager );
 
-    MUTEX_SCOPE_LOCK( mutex_ );
+    std::unique_lock<std::shared_timed_mutex> writer_lock( mutex_ );
 
     config_         = config;
     user_manager_   = user_manager;
+    event_sink_     = event_sink;
+
+    if( event_sink_ )
+    {
+        if( events_ == nullptr )
+            events_.reset( new EventRing );
+    }
+    else
+    {
+        events_.reset();
+    }
+
+    load_pending();
+
+    if( exceeds_limits( 0, 0 ) )
+    {
+        if( config_.reject_on_overflow )
+        {
+            // keep loaded records, new registrations are rejected until the store is back under the limits
+            dummy_log_warn( MODULENAME, "init: %u pending registration(s), approx. %u bytes exceed the limits, new registrations will be rejected",
+                    unsigned( pending_.size() ), unsigned( pending_memory_ ) );
+        }
+        else
+        {
+            dummy_log_warn( MODULENAME, "init: %u pending registration(s), approx. %u bytes exceed the limits, evicting",
+                    unsigned( pending_.size() ), unsigned( pending_memory_ ) );
+
+            evict( 0, 0, "init" );
+        }
+    }
 
     return true;
 }
 
+void UserReg::start()
+{
+    dummy_log_info( MODULENAME, "start" );
+
+    ASSERT( worker_.joinable() == false );
+
+    must_stop_  = false;
+
+    worker_     = std::thread( & UserReg::worker, this );
+}
+
+void UserReg::shutdown()
+{
+    if( worker_.joinable() == false )
+        return;
+
+    dummy_log_info( MODULENAME, "shutdown" );
+
+    must_stop_  = true;
+
+    worker_.join();
+}
+
+uint64_t UserReg::get_dropped_events() const
+{
+    std::shared_lock<std::shared_timed_mutex> reader_lock( mutex_ );
+
+    return dropped_events_;
+}
+
 bool UserReg::register_new_user(
         user_manager::group_id_t    group_id,
         const std::string           & email,
@@ -73,7 +149,7 @@ bool UserReg::register_new_user(
         std::string                 * registration_key,
         std::string                 * error_msg )
 {
-    MUTEX_SCOPE_LOCK( mutex_ );
+    std::unique_lock<std::shared_timed_mutex> writer_lock( mutex_ );
 
     remove_expired();
 
@@ -87,6 +163,23 @@ bool UserReg::register_new_user(
         return false;
     }
 
+    // evict other registrations only once the new one was accepted, otherwise a rejected request could push them out
+    auto size = estimate_size( email, password_hash, * registration_key );
+
+    if( make_room( size, error_msg ) == false )
+    {
+        dummy_log_error( MODULENAME, "register_new_user: cannot add new user: %s", error_msg->c_str() );
+
+        std::string error_msg_2;
+
+        if( user_manager_->delete_user( * user_id, & error_msg_2 ) == false )
+        {
+            dummy_log_error( MODULENAME, "register_new_user: cannot roll back user id %u: %s", * user_id, error_msg_2.c_str() );
+        }
+
+        return false;
+    }
+
     auto expiration = utils::get_now_epoch() + config_.expiration_days * 24 * 60 * 60
 #ifdef DEBUG
             / speedup_factor_
@@ -95,6 +188,10 @@ bool UserReg::register_new_user(
 
     update_user( * user_id, expiration );
 
+    add_pending( * user_id, * registration_key, expiration, size );
+
+    send_event( event_type_e::REGISTERED, * user_id, expiration );
+
     dummy_log_info( MODULENAME, "register_new_user: id %u, registration_key %s, expiration %s (%u)", * user_id, registration_key->c_str(), utils::epoch_to_string( expiration ).c_str(), expiration );
 
     return true;
@@ -106,7 +203,7 @@ bool UserReg::confirm_registration(
 {
     dummy_log_trace( MODULENAME, "confirm_registration: registration_key %s", registration_key.c_str() );
 
-    MUTEX_SCOPE_LOCK( mutex_ );
+    std::unique_lock<std::shared_timed_mutex> writer_lock( mutex_ );
 
     remove_expired();
 
@@ -145,6 +242,10 @@ bool UserReg::confirm_registration(
     user.delete_field( user_manager::User::REGISTRATION_EXPIRATION );
     user.add_field( user_manager::User::REGISTRATION_TIME,    int( now ) );
 
+    remove_pending( user_id );
+
+    send_event( event_type_e::CONFIRMED, user_id, 0 );
+
     dummy_log_info( MODULENAME, "confirm_registration: user id %u - confirmed registration", user_id );
 
     return true;
@@ -160,32 +261,95 @@ void UserReg::set_speedup_factor( uint32_t factor )
 #endif
 }
 
-void UserReg::remove_expired()
+MemoryUsage UserReg::get_memory_usage() const
 {
-    auto now = utils::get_now_epoch();
+    std::shared_lock<std::shared_timed_mutex> reader_lock( mutex_ );
 
-    auto res = user_manager_->select_users__unlocked( user_manager::User::REGISTRATION_EXPIRATION, anyvalue::comparison_type_e::LT, int( now ) );
+    MemoryUsage res;
 
-    dummy_log_debug( MODULENAME, "remove_expired: found %u expired registration key(s)", res.size() );
+    res.pending_registrations       = pending_.size();
+    res.pending_memory              = pending_memory_;
+    res.max_pending_registrations   = config_.max_pending_registrations;
+    res.max_pending_memory          = config_.max_pending_memory;
 
-    if( res.empty() )
-        return;
+    return res;
+}
 
-    for( auto & u : res )
+bool UserReg::is_key_pending( const std::string & registration_key ) const
+{
+    std::shared_lock<std::shared_timed_mutex> reader_lock( mutex_ );
+
+    auto it = key_to_user_id_.find( registration_key );
+
+    if( it == key_to_user_id_.end() )
+        return false;
+
+    auto it_2 = pending_.find( it->second );
+
+    ASSERT( it_2 != pending_.end() );
+
+    return it_2->second.expiration >= utils::get_now_epoch();
+}
+
+uint32_t UserReg::pending_count() const
+{
+    // may include expired registrations, which are not removed yet
+    return pending_count_.load( std::memory_order_relaxed );
+}
+
+registration_status_e UserReg::get_registration_status( user_id_t user_id ) const
+{
+    std::shared_lock<std::shared_timed_mutex> reader_lock( mutex_ );
+
+    auto it = pending_.find( user_id );
+
+    if( it != pending_.end() )
     {
-        auto user_id = u.get_user_id();
+        if( it->second.expiration < utils::get_now_epoch() )
+            return registration_status_e::EXPIRED;
 
-        std::string error_msg;
+        return registration_status_e::PENDING;
+    }
 
-        auto b = user_manager_->delete_user( user_id, & error_msg );
+    reader_lock.unlock();
 
-        if( b == false )
-        {
-            dummy_log_error( MODULENAME, "remove_expired: cannot delete user id %u: %s", user_id, error_msg.c_str() );
-        }
+    // not pending: look up the user in UserManager, this contends on its exclusive mutex
+    auto & mutex = user_manager_->get_mutex();
+
+    MUTEX_SCOPE_LOCK( mutex );
+
+    auto user   = user_manager_->find__unlocked( user_id );
+
+    if( user.is_empty() || user.is_open() == false )
+        return registration_status_e::UNKNOWN;
+
+    auto status_v = user.get_field( user_manager::User::STATUS );
+
+    if( static_cast<user_manager::status_e>( status_v.arg_i ) == user_manager::status_e::ACTIVE )
+        return registration_status_e::CONFIRMED;
+
+    return registration_status_e::UNKNOWN;
+}
+
+void UserReg::remove_expired()
+{
+    auto now = utils::get_now_epoch();
+
+    uint32_t num = 0;
+
+    while( expiration_index_.empty() == false && expiration_index_.begin()->first < now )
+    {
+        delete_pending_user( expiration_index_.begin()->second, event_type_e::EXPIRED, "remove_expired" );
+
+        ++num;
+    }
+
+    if( num > 0 )
+    {
+        dummy_log_debug( MODULENAME, "remove_expired: expired %u registration key(s)", num );
     }
 
-    dummy_log_debug( MODULENAME, "remove_expired: expired %u registration key(s)", res.size() );
+    notify_expiring( now );
 }
 
 void UserReg::update_user( user_id_t user_id, utils::epoch32_t expiration )
@@ -200,4 +364,235 @@ void UserReg::update_user( user_id_t user_id, utils::epoch32_t expiration )
     user.add_field( user_manager::User::REGISTRATION_EXPIRATION,    int( expiration ) );
 }
 
+void UserReg::load_pending()
+{
+    pending_.clear();
+    key_to_user_id_.clear();
+    expiration_index_.clear();
+    expiring_index_.clear();
+    pending_memory_ = 0;
+    pending_count_  = 0;
+
+    auto & mutex = user_manager_->get_mutex();
+
+    MUTEX_SCOPE_LOCK( mutex );
+
+    auto res = user_manager_->select_users__unlocked( user_manager::User::STATUS, anyvalue::comparison_type_e::EQ, int( user_manager::status_e::WAITING_REGISTRATION_CONFIRMATION ) );
+
+    for( auto & u : res )
+    {
+        auto expiration_v       = u.get_field( user_manager::User::REGISTRATION_EXPIRATION );
+        auto registration_key_v = u.get_field( user_manager::User::REGISTRATION_KEY );
+        auto login_v            = u.get_field( user_manager::User::LOGIN );
+        auto password_hash_v    = u.get_field( user_manager::User::PASSWORD_HASH );
+
+        auto & registration_key = registration_key_v.arg_s;
+
+        auto size = estimate_size( login_v.arg_s, password_hash_v.arg_s, registration_key );
+
+        add_pending( u.get_user_id(), registration_key, expiration_v.arg_i, size );
+    }
+
+    dummy_log_debug( MODULENAME, "load_pending: found %u pending registration(s), approx. %u bytes", pending_.size(), unsigned( pending_memory_ ) );
+}
+
+bool UserReg::make_room( uint64_t size, std::string * error_msg )
+{
+    // a registration, which doesn't fit even into an empty store, must not evict anything
+    if( config_.max_pending_memory > 0 && size > config_.max_pending_memory )
+    {
+        * error_msg = "registration exceeds memory limit for pending registrations";
+        return false;
+    }
+
+    if( exceeds_limits( 1, size ) == false )
+        return true;
+
+    if( config_.reject_on_overflow )
+    {
+        if( exceeds_limits( 1, 0 ) )
+            * error_msg = "too many pending registrations";
+        else
+            * error_msg = "memory limit for pending registrations is reached";
+
+        return false;
+    }
+
+    evict( 1, size, "make_room" );
+
+    if( exceeds_limits( 1, size ) )
+    {
+        * error_msg = "registration exceeds memory limit for pending registrations";
+        return false;
+    }
+
+    return true;
+}
+
+bool UserReg::exceeds_limits( uint32_t num, uint64_t size ) const
+{
+    return ( config_.max_pending_registrations > 0 && pending_.size() + num > config_.max_pending_registrations )
+        || ( config_.max_pending_memory > 0 && pending_memory_ + size > config_.max_pending_memory );
+}
+
+void UserReg::evict( uint32_t num, uint64_t size, const char * reason )
+{
+    uint32_t evicted = 0;
+
+    // evict the registrations closest to expiry first
+    while( exceeds_limits( num, size ) && expiration_index_.empty() == false )
+    {
+        delete_pending_user( expiration_index_.begin()->second, event_type_e::EVICTED, reason );
+
+        ++evicted;
+    }
+
+    if( evicted > 0 )
+    {
+        dummy_log_info( MODULENAME, "%s: evicted %u pending registration(s)", reason, evicted );
+    }
+}
+
+void UserReg::add_pending( user_id_t user_id, const std::string & registration_key, utils::epoch32_t expiration, uint64_t size )
+{
+    auto b = pending_.insert( std::make_pair( user_id, PendingRegistration { registration_key, expiration, size } ) ).second;
+
+    ASSERT( b );
+
+    key_to_user_id_.insert( std::make_pair( registration_key, user_id ) );
+
+    expiration_index_.insert( std::make_pair( expiration, user_id ) );
+
+    if( config_.expiry_warning_sec > 0 )
+        expiring_index_.insert( std::make_pair( expiration, user_id ) );
+
+    pending_memory_ += size;
+
+    pending_count_.store( pending_.size(), std::memory_order_relaxed );
+}
+
+void UserReg::remove_pending( user_id_t user_id )
+{
+    auto it = pending_.find( user_id );
+
+    if( it == pending_.end() )
+        return;
+
+    key_to_user_id_.erase( it->second.registration_key );
+
+    expiration_index_.erase( std::make_pair( it->second.expiration, user_id ) );
+    expiring_index_.erase( std::make_pair( it->second.expiration, user_id ) );
+
+    pending_memory_ -= it->second.size;
+
+    pending_.erase( it );
+
+    pending_count_.store( pending_.size(), std::memory_order_relaxed );
+}
+
+void UserReg::delete_pending_user( user_id_t user_id, event_type_e type, const char * reason )
+{
+    std::string error_msg;
+
+    auto b = user_manager_->delete_user( user_id, & error_msg );
+
+    if( b == false )
+    {
+        dummy_log_error( MODULENAME, "%s: cannot delete user id %u: %s", reason, user_id, error_msg.c_str() );
+    }
+
+    auto it = pending_.find( user_id );
+
+    ASSERT( it != pending_.end() );
+
+    send_event( type, user_id, it->second.expiration );
+
+    remove_pending( user_id );
+}
+
+void UserReg::notify_expiring( utils::epoch32_t now )
+{
+    while( expiring_index_.empty() == false && expiring_index_.begin()->first < now + config_.expiry_warning_sec )
+    {
+        auto it = expiring_index_.begin();
+
+        send_event( event_type_e::EXPIRING, it->second, it->first );
+
+        expiring_index_.erase( it );
+    }
+}
+
+void UserReg::send_event( event_type_e type, user_id_t user_id, utils::epoch32_t expiration )
+{
+    if( event_sink_ == nullptr )
+        return;
+
+    Event e = { type, user_id, expiration, utils::get_now_epoch(), next_event_seq_++ };
+
+    if( events_->push( e ) )
+    {
+        is_dropping_    = false;
+        return;
+    }
+
+    ++dropped_events_;
+
+    // log only the first dropped event in a row
+    if( is_dropping_ == false )
+    {
+        dummy_log_error( MODULENAME, "send_event: event queue is full, dropping events, starting with seq %u", unsigned( e.seq ) );
+
+        is_dropping_    = true;
+    }
+}
+
+void UserReg::worker()
+{
+    dummy_log_debug( MODULENAME, "worker: started" );
+
+    while( must_stop_ == false )
+    {
+        housekeeping();
+
+        deliver_events();
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( WORKER_INTERVAL_MS ) );
+    }
+
+    deliver_events();
+
+    dummy_log_debug( MODULENAME, "worker: stopped" );
+}
+
+void UserReg::housekeeping()
+{
+    std::unique_lock<std::shared_timed_mutex> writer_lock( mutex_ );
+
+    if( user_manager_ == nullptr )
+        return;
+
+    remove_expired();
+}
+
+void UserReg::deliver_events()
+{
+    if( event_sink_ == nullptr )
+        return;
+
+    while( events_->pop( & batch_, MAX_EVENT_BATCH_SIZE ) > 0 )
+    {
+        event_sink_->handle_events( batch_ );
+
+        batch_.clear();
+    }
+}
+
+uint64_t UserReg::estimate_size(
+        const std::string           & email,
+        const std::string           & password_hash,
+        const std::string           & registration_key )
+{
+    return PENDING_OVERHEAD_SIZE + email.size() + password_hash.size() + registration_key.size();
+}
+
 } // namespace user_reg
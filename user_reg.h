@@ -24,10 +24,17 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #ifndef USER_REG__USER_REG_H
 #define USER_REG__USER_REG_H
 
-#include <mutex>            // std::mutex
+#include <shared_mutex>     // std::shared_timed_mutex
+#include <atomic>           // std::atomic
+#include <map>              // std::map
+#include <set>              // std::set
+#include <thread>           // std::thread
+#include <memory>           // std::unique_ptr
 
 #include "user_manager/user_manager.h"  // UserManager
 #include "config.h"         // Config
+#include "events.h"         // Event, IEventSink
+#include "ring_buffer.h"    // RingBuffer
 
 namespace user_reg
 {
@@ -35,6 +42,22 @@ namespace user_reg
 using user_id_t = user_manager::user_id_t;
 using group_id_t = user_manager::group_id_t;
 
+enum class registration_status_e
+{
+    UNKNOWN = 0,        // not found, deleted or removed as expired
+    PENDING,
+    EXPIRED,            // expired, but not removed yet
+    CONFIRMED,
+};
+
+struct MemoryUsage
+{
+    uint32_t    pending_registrations;
+    uint64_t    pending_memory;             // approximate bytes
+    uint32_t    max_pending_registrations;  // 0 - unlimited
+    uint64_t    max_pending_memory;         // 0 - unlimited
+};
+
 class UserReg
 {
 
@@ -43,9 +66,21 @@ public:
     UserReg();
     ~UserReg();
 
+    // user_manager must be fully loaded before init(), its pending registrations are read only once here;
+    // afterwards pending registrations must be created, confirmed and removed through UserReg only,
+    // records added or deleted directly in UserManager are neither expired nor counted towards the limits
     bool init(
             const Config                & config,
-            user_manager::UserManager   * user_manager );
+            user_manager::UserManager   * user_manager,
+            IEventSink                  * event_sink = nullptr );
+
+    // starts the worker thread, which removes expired registrations and delivers events to event sink;
+    // required if event_sink is given, otherwise events are dropped once the event queue is full
+    void start();
+    void shutdown();
+
+    // number of events dropped due to full event queue
+    uint64_t get_dropped_events() const;
 
     bool register_new_user(
             user_manager::group_id_t    group_id,
@@ -61,17 +96,79 @@ public:
 
     void set_speedup_factor( uint32_t factor );
 
+    MemoryUsage get_memory_usage() const;
+
+    // read-only queries: don't modify the store and don't remove expired registrations
+
+    // takes a shared lock
+    bool is_key_pending( const std::string & registration_key ) const;
+    // lock-free
+    uint32_t pending_count() const;
+    // takes a shared lock; for a user, which is not pending, also takes exclusive mutex of UserManager
+    registration_status_e get_registration_status( user_id_t user_id ) const;
+
+private:
+
+    struct PendingRegistration
+    {
+        std::string         registration_key;
+        utils::epoch32_t    expiration;
+        uint64_t            size;
+    };
+
+    typedef std::map<user_id_t,PendingRegistration>                 MapUserIdToPending;
+    typedef std::map<std::string,user_id_t>                         MapKeyToUserId;
+    typedef std::set<std::pair<utils::epoch32_t,user_id_t>>         SetExpiration;
+    typedef RingBuffer<Event,4096>                                  EventRing;
+
 private:
 
     void remove_expired();
     void update_user( user_id_t user_id, utils::epoch32_t expiration );
 
+    void load_pending();
+    bool make_room( uint64_t size, std::string * error_msg );
+    bool exceeds_limits( uint32_t num, uint64_t size ) const;
+    void evict( uint32_t num, uint64_t size, const char * reason );
+    void add_pending( user_id_t user_id, const std::string & registration_key, utils::epoch32_t expiration, uint64_t size );
+    void remove_pending( user_id_t user_id );
+    void delete_pending_user( user_id_t user_id, event_type_e type, const char * reason );
+    void notify_expiring( utils::epoch32_t now );
+
+    void send_event( event_type_e type, user_id_t user_id, utils::epoch32_t expiration );
+
+    void worker();
+    void housekeeping();
+    void deliver_events();
+
+    static uint64_t estimate_size(
+            const std::string           & email,
+            const std::string           & password_hash,
+            const std::string           & registration_key );
+
 private:
-    mutable std::mutex          mutex_;
+    mutable std::shared_timed_mutex mutex_;
 
     Config                      config_;
     user_manager::UserManager   * user_manager_;
 
+    MapUserIdToPending          pending_;
+    MapKeyToUserId              key_to_user_id_;
+    SetExpiration               expiration_index_;
+    SetExpiration               expiring_index_;    // not yet notified as expiring
+    uint64_t                    pending_memory_;
+    std::atomic<uint32_t>       pending_count_;
+
+    IEventSink                  * event_sink_;
+    std::unique_ptr<EventRing>  events_;            // allocated only with event sink, produced under mutex_, consumed by worker
+    uint64_t                    next_event_seq_;
+    uint64_t                    dropped_events_;
+    bool                        is_dropping_;
+    std::vector<Event>          batch_;             // accessed by worker only
+
+    std::thread                 worker_;
+    std::atomic<bool>           must_stop_;
+
 //#ifdef DEBUG
     uint32_t                    speedup_factor_;
 //#endif